@@ -0,0 +1,26 @@
+{
+  'variables': {
+    # The sources of the C++ reference implementation are copied into deps/
+    # when the package is packed, and used from ../large_page otherwise.
+    'large_page_dir%': '<!(node -p "require(\'fs\').existsSync(\'deps/large_page.cc\') ? \'deps\' : \'../large_page\'")',
+  },
+  'targets': [
+    {
+      'target_name': 'large_page',
+      'sources': [
+        'large_page_addon.cc',
+        '<(large_page_dir)/large_page.cc',
+      ],
+      'include_dirs': [ '<(large_page_dir)' ],
+      'libraries': [ '-ldl' ],
+      # FindTextRegion() relies on std::regex, which reports errors by
+      # throwing.
+      'cflags_cc!': [ '-fno-exceptions' ],
+      'conditions': [
+        [ 'OS=="linux"', {
+          'defines': [ 'ENABLE_LARGE_CODE_PAGES=1' ],
+        }],
+      ],
+    },
+  ],
+}
@@ -0,0 +1,25 @@
+// Copyright (C) 2018 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+
+'use strict';
+
+const fs = require('fs');
+const binding = require('./build/Release/large_page.node');
+
+function escapeRegex(text) {
+  return text.replace(/[\\^$.|?*+()[\]{}]/g, '\\$&');
+}
+
+// Remap the code of an object that is already loaded, such as a native addon,
+// given its file name. For an addon this is the path of its .node file, e.g.
+// require.resolve('some-addon/build/Release/binding.node'). The maps file lists
+// the real path of the object, so symbolic links are resolved.
+function mapFile(filename) {
+  binding.mapDSO(`^${escapeRegex(fs.realpathSync(filename))}$`);
+}
+
+module.exports = {
+  ...binding,
+  mapFile,
+};
@@ -0,0 +1,717 @@
+// Copyright (C) 2018 Intel Corporation
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom
+// the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES
+// OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+// SPDX-License-Identifier: MIT
+
+#include <node_api.h>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+#include "large_page.h"
+
+namespace largepage {
+
+  using std::ifstream;
+  using std::istringstream;
+  using std::lock_guard;
+  using std::map;
+  using std::mutex;
+  using std::string;
+  using std::vector;
+
+namespace {
+
+#define NAPI_CALL(env, call)                                              \
+  do {                                                                    \
+    if ((call) != napi_ok) {                                              \
+      ThrowLastError((env));                                              \
+      return nullptr;                                                     \
+    }                                                                     \
+  } while (0)
+
+void ThrowLastError(napi_env env) {
+  const napi_extended_error_info* info;
+  bool is_pending;
+  napi_get_last_error_info(env, &info);
+  napi_is_exception_pending(env, &is_pending);
+  if (!is_pending) {
+    napi_throw_error(env, nullptr,
+                     (info->error_message != nullptr) ? info->error_message
+                                                      : "N-API call failed");
+  }
+}
+
+// Throw an error whose message is the verbose text of the status and whose
+// code is its terse text, e.g. "map_region_too_small".
+void ThrowMapStatus(napi_env env, MapStatus status) {
+  napi_throw_error(env,
+                   MapStatusStr(status, false).c_str(),
+                   MapStatusStr(status, true).c_str());
+}
+
+void ThrowErrno(napi_env env, const char* code, int err) {
+  napi_throw_error(env, code, strerror(err));
+}
+
+uint64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Remapping affects the whole process, so the telemetry is kept per process
+// rather than per environment, and is shared by all worker threads.
+struct RemapRecord {
+  string target;
+  MapStatus status;
+  uint64_t duration_ns;
+};
+
+// A range of an object's file which has been copied into an anonymous
+// mapping. Once remapped, the range no longer has a pathname in the maps file,
+// and a single anonymous mapping may hold ranges of several objects.
+struct Segment {
+  uintptr_t start;
+  uintptr_t end;
+  string path;
+};
+
+mutex remap_mutex;
+vector<RemapRecord> remap_records;
+vector<Segment> remapped_segments;
+
+// Read the start, end, permissions and pathname of each mapping in the maps
+// file. Anonymous mappings have an empty pathname.
+MapStatus ReadMaps(vector<Segment>* segments, vector<string>* permissions) {
+  ifstream ifs("/proc/self/maps");
+  if (!ifs) {
+    return map_maps_open_failed;
+  }
+
+  string map_line;
+  while (getline(ifs, map_line)) {
+    string permission, offset, dev, pathname;
+    uint64_t inode;
+    uintptr_t start, end;
+    char dash;
+
+    istringstream iss(map_line);
+    iss >> std::hex >> start >> dash >> end;
+    if (iss.fail() || dash != '-') {
+      return map_malformed_maps_file;
+    }
+    iss >> permission >> offset >> dev >> inode >> pathname;
+    segments->push_back({start, end, pathname});
+    permissions->push_back(permission);
+  }
+  return map_ok;
+}
+
+// Record which ranges of which objects ended up in the executable anonymous
+// mappings created by a remap, by comparing the maps file before and after it.
+// Must be called with remap_mutex held.
+void RecordRemappedSegments(const vector<Segment>& before,
+                            const vector<Segment>& after,
+                            const vector<string>& after_permissions) {
+  for (size_t idx = 0; idx < after.size(); idx++) {
+    const Segment& anon = after[idx];
+    if (!anon.path.empty() || after_permissions[idx][2] != 'x') {
+      continue;
+    }
+    for (const Segment& file : before) {
+      if (file.end <= anon.start || file.start >= anon.end ||
+          file.path.empty() || file.path[0] == '[') {
+        continue;
+      }
+      remapped_segments.push_back({std::max(file.start, anon.start),
+                                   std::min(file.end, anon.end), file.path});
+    }
+  }
+}
+
+template <typename Remap>
+MapStatus RecordRemap(const string& target, Remap remap) {
+  lock_guard<mutex> lock(remap_mutex);
+  vector<Segment> before, after;
+  vector<string> before_permissions, after_permissions;
+  MapStatus maps_status = ReadMaps(&before, &before_permissions);
+  uint64_t start = NowNs();
+  MapStatus status = remap();
+  remap_records.push_back({target, status, NowNs() - start});
+  // Even a failed remap may have moved some regions, e.g. all but the last run
+  // of mapAdjacentDSOs(), so the segments are recorded regardless.
+  if (maps_status == map_ok &&
+      ReadMaps(&after, &after_permissions) == map_ok) {
+    RecordRemappedSegments(before, after, after_permissions);
+  }
+  return status;
+}
+
+MapStatus ExecutablePath(string* path) {
+  char selfexe[PATH_MAX] = {0};
+  ssize_t count = readlink("/proc/self/exe", selfexe, PATH_MAX);
+  if (count < 0) {
+    return map_exe_path_read_failed;
+  }
+  path->assign(selfexe, count);
+  return map_ok;
+}
+
+// Find the largest executable range of the given file. The executable may have
+// several of them, e.g. when the linker separates out small stubs, and the
+// first of them is not necessarily the .text section. Ranges which have
+// already been remapped, e.g. by a window of mapAdjacentDSOs(), are anonymous
+// and are found through remapped_segments, so that they are merged with the
+// rest of the text. Must be called with remap_mutex held.
+MapStatus FindLargestTextMapping(const string& path, void** from, void** to) {
+  vector<Segment> segments;
+  vector<string> permissions;
+  MapStatus status = ReadMaps(&segments, &permissions);
+  if (status != map_ok) {
+    return status;
+  }
+
+  vector<Segment> text;
+  for (size_t idx = 0; idx < segments.size(); idx++) {
+    const Segment& m = segments[idx];
+    if (permissions[idx][2] != 'x') {
+      continue;
+    }
+    if (m.path == path) {
+      text.push_back(m);
+      continue;
+    }
+    if (!m.path.empty()) {
+      continue;
+    }
+    for (const Segment& r : remapped_segments) {
+      if (r.path == path && r.end > m.start && r.start < m.end) {
+        text.push_back({std::max(r.start, m.start), std::min(r.end, m.end),
+                        path});
+      }
+    }
+  }
+  std::sort(text.begin(), text.end(),
+            [](const Segment& a, const Segment& b) {
+              return a.start < b.start;
+            });
+
+  uintptr_t best_start = 0, best_end = 0;
+  for (size_t idx = 0; idx < text.size();) {
+    uintptr_t start = text[idx].start, end = text[idx].end;
+    for (idx++; idx < text.size() && text[idx].start <= end; idx++) {
+      end = std::max(end, text[idx].end);
+    }
+    if (end - start > best_end - best_start) {
+      best_start = start;
+      best_end = end;
+    }
+  }
+
+  if (best_end == 0) {
+    return map_region_not_found;
+  }
+  *from = reinterpret_cast<void*>(best_start);
+  *to = reinterpret_cast<void*>(best_end);
+  return map_ok;
+}
+
+napi_value GetString(napi_env env, napi_value value, string* result) {
+  size_t length;
+  NAPI_CALL(env, napi_get_value_string_utf8(env, value, nullptr, 0, &length));
+  result->resize(length + 1);
+  NAPI_CALL(env, napi_get_value_string_utf8(env, value, &(*result)[0],
+                                            length + 1, &length));
+  result->resize(length);
+  return value;
+}
+
+napi_value SetNamedString(napi_env env, napi_value object, const char* name,
+                          const string& value) {
+  napi_value js_value;
+  NAPI_CALL(env, napi_create_string_utf8(env, value.c_str(), value.size(),
+                                         &js_value));
+  NAPI_CALL(env, napi_set_named_property(env, object, name, js_value));
+  return object;
+}
+
+napi_value SetNamedNumber(napi_env env, napi_value object, const char* name,
+                          double value) {
+  napi_value js_value;
+  NAPI_CALL(env, napi_create_double(env, value, &js_value));
+  NAPI_CALL(env, napi_set_named_property(env, object, name, js_value));
+  return object;
+}
+
+// isLargePagesEnabled(): boolean
+napi_value IsLargePagesEnabledJS(napi_env env, napi_callback_info info) {
+  bool enabled;
+  MapStatus status = IsLargePagesEnabled(&enabled);
+  if (status != map_ok) {
+    ThrowMapStatus(env, status);
+    return nullptr;
+  }
+
+  napi_value result;
+  NAPI_CALL(env, napi_get_boolean(env, enabled, &result));
+  return result;
+}
+
+// mapNodeText(): undefined
+// The executable is located by its path rather than through __textsegment,
+// because node is not linked with ld.implicit.script.
+napi_value MapNodeTextJS(napi_env env, napi_callback_info info) {
+  string exename;
+  void* from = nullptr;
+  void* to = nullptr;
+  MapStatus status = ExecutablePath(&exename);
+  if (status == map_ok) {
+    status = RecordRemap(exename, [&]() {
+      MapStatus found = FindLargestTextMapping(exename, &from, &to);
+      if (found != map_ok) {
+        return found;
+      }
+      return MapStaticCodeToLargePages(from, to);
+    });
+  }
+  if (status != map_ok) {
+    ThrowMapStatus(env, status);
+  }
+  return nullptr;
+}
+
+// mapDSO(regex: string): undefined
+napi_value MapDSOJS(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  napi_valuetype type;
+  string regexpr;
+
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+  if (argc < 1) {
+    ThrowMapStatus(env, map_null_regex);
+    return nullptr;
+  }
+  NAPI_CALL(env, napi_typeof(env, argv[0], &type));
+  if (type != napi_string) {
+    napi_throw_type_error(env, nullptr, "regex must be a string");
+    return nullptr;
+  }
+  if (GetString(env, argv[0], &regexpr) == nullptr) {
+    return nullptr;
+  }
+
+  MapStatus status = RecordRemap(regexpr, [&]() {
+    return MapStaticCodeToLargePages(regexpr);
+  });
+  if (status != map_ok) {
+    ThrowMapStatus(env, status);
+  }
+  return nullptr;
+}
+
+// mapAdjacentDSOs(regex?: string): undefined
+napi_value MapAdjacentDSOsJS(napi_env env, napi_callback_info info) {
+  size_t argc = 1;
+  napi_value argv[1];
+  napi_valuetype type;
+  string regexpr;
+
+  NAPI_CALL(env, napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr));
+  if (argc > 0) {
+    NAPI_CALL(env, napi_typeof(env, argv[0], &type));
+    if (type == napi_string) {
+      if (GetString(env, argv[0], &regexpr) == nullptr) {
+        return nullptr;
+      }
+    } else if (type != napi_undefined) {
+      napi_throw_type_error(env, nullptr, "regex must be a string");
+      return nullptr;
+    }
+  }
+
+  MapStatus status = RecordRemap("adjacent:" + regexpr, [&]() {
+    return MapAdjacentCodeToLargePages(regexpr);
+  });
+  if (status != map_ok) {
+    ThrowMapStatus(env, status);
+  }
+  return nullptr;
+}
+
+// remapStats(): Array<{ target, status, message, durationMs }>
+napi_value RemapStatsJS(napi_env env, napi_callback_info info) {
+  lock_guard<mutex> lock(remap_mutex);
+  napi_value result;
+  NAPI_CALL(env, napi_create_array_with_length(env, remap_records.size(),
+                                               &result));
+  for (size_t idx = 0; idx < remap_records.size(); idx++) {
+    const RemapRecord& record = remap_records[idx];
+    napi_value entry;
+    NAPI_CALL(env, napi_create_object(env, &entry));
+    if (SetNamedString(env, entry, "target", record.target) == nullptr ||
+        SetNamedString(env, entry, "status",
+                       MapStatusStr(record.status, false)) == nullptr ||
+        SetNamedString(env, entry, "message",
+                       MapStatusStr(record.status, true)) == nullptr ||
+        SetNamedNumber(env, entry, "durationMs",
+                       record.duration_ns / 1e6) == nullptr) {
+      return nullptr;
+    }
+    NAPI_CALL(env, napi_set_element(env, result, idx, entry));
+  }
+  return result;
+}
+
+struct Coverage {
+  string path;
+  uint64_t size;
+  uint64_t huge;
+};
+
+Coverage* FindCoverage(const string& path, map<string, size_t>* index,
+                       vector<Coverage>* objects) {
+  auto found = index->find(path);
+  if (found == index->end()) {
+    found = index->emplace(path, objects->size()).first;
+    objects->push_back({path, 0, 0});
+  }
+  return &(*objects)[found->second];
+}
+
+// Spread the size and huge page bytes of an executable anonymous mapping over
+// the object ranges that were remapped into it, in proportion to their share
+// of the mapping. Anonymous code which was not remapped by the addon, such as
+// the output of the JIT, does not belong to any object and is skipped.
+void AttributeAnonymous(uintptr_t start, uintptr_t end, uint64_t size,
+                        uint64_t huge, map<string, size_t>* index,
+                        vector<Coverage>* objects) {
+  if (end <= start) {
+    return;
+  }
+  for (const Segment& r : remapped_segments) {
+    if (r.end <= start || r.start >= end) {
+      continue;
+    }
+    uint64_t overlap = std::min(r.end, end) - std::max(r.start, start);
+    Coverage* coverage = FindCoverage(r.path, index, objects);
+    coverage->size += size * overlap / (end - start);
+    coverage->huge += huge * overlap / (end - start);
+  }
+}
+
+// Collect the size of the executable mappings of each object and the portion
+// of it which is backed by huge pages. A remapped region is anonymous and has
+// no pathname in the smaps file, so it is attributed to the objects recorded
+// in remapped_segments when it was remapped.
+MapStatus ReadCoverage(vector<Coverage>* objects) {
+  ifstream ifs("/proc/self/smaps");
+  if (!ifs) {
+    return map_maps_open_failed;
+  }
+
+  lock_guard<mutex> lock(remap_mutex);
+  map<string, size_t> index;
+  string line;
+  Coverage* current = nullptr;
+  // The executable anonymous mapping whose fields are being read.
+  bool anonymous = false;
+  uintptr_t anon_start = 0, anon_end = 0;
+  uint64_t anon_size = 0, anon_huge = 0;
+
+// The smaps file consists of a header line per mapping, in the same format as
+// the maps file, followed by "<Field>: <value> kB" lines.
+  while (getline(ifs, line)) {
+    istringstream iss(line);
+    string first;
+    iss >> first;
+    if (first.empty()) {
+      continue;
+    }
+
+    if (*first.rbegin() == ':') {
+      if (current == nullptr && !anonymous) {
+        continue;
+      }
+      uint64_t kb = 0;
+      iss >> kb;
+      uint64_t* size = anonymous ? &anon_size : &current->size;
+      uint64_t* huge = anonymous ? &anon_huge : &current->huge;
+      if (first == "Size:") {
+        *size += kb * 1024;
+      } else if (first == "AnonHugePages:" || first == "FilePmdMapped:") {
+        *huge += kb * 1024;
+      }
+      continue;
+    }
+
+    if (anonymous) {
+      AttributeAnonymous(anon_start, anon_end, anon_size, anon_huge, &index,
+                         objects);
+    }
+
+    uintptr_t start, end;
+    string permission, offset, dev, path;
+    uint64_t inode;
+    char dash;
+    istringstream header(first);
+    header >> std::hex >> start >> dash >> end;
+    if (header.fail() || dash != '-') {
+      return map_malformed_maps_file;
+    }
+    iss >> permission >> offset >> dev >> inode;
+    iss >> path;
+
+    current = nullptr;
+    anonymous = false;
+    if (permission.size() < 3 || permission[2] != 'x') {
+      continue;
+    }
+    if (path.empty()) {
+      anonymous = true;
+      anon_start = start;
+      anon_end = end;
+      anon_size = anon_huge = 0;
+      continue;
+    }
+    current = FindCoverage(path, &index, objects);
+  }
+  if (anonymous) {
+    AttributeAnonymous(anon_start, anon_end, anon_size, anon_huge, &index,
+                       objects);
+  }
+
+  return map_ok;
+}
+
+// hugePageCoverage():
+//   { size, hugePageBytes, objects: Array<{ path, size, hugePageBytes }> }
+napi_value HugePageCoverageJS(napi_env env, napi_callback_info info) {
+  vector<Coverage> objects;
+  MapStatus status = ReadCoverage(&objects);
+  if (status != map_ok) {
+    ThrowMapStatus(env, status);
+    return nullptr;
+  }
+
+  napi_value result, js_objects;
+  uint64_t size = 0, huge = 0;
+  NAPI_CALL(env, napi_create_object(env, &result));
+  NAPI_CALL(env, napi_create_array_with_length(env, objects.size(),
+                                               &js_objects));
+  for (size_t idx = 0; idx < objects.size(); idx++) {
+    napi_value entry;
+    NAPI_CALL(env, napi_create_object(env, &entry));
+    if (SetNamedString(env, entry, "path", objects[idx].path) == nullptr ||
+        SetNamedNumber(env, entry, "size", objects[idx].size) == nullptr ||
+        SetNamedNumber(env, entry, "hugePageBytes",
+                       objects[idx].huge) == nullptr) {
+      return nullptr;
+    }
+    NAPI_CALL(env, napi_set_element(env, js_objects, idx, entry));
+    size += objects[idx].size;
+    huge += objects[idx].huge;
+  }
+  if (SetNamedNumber(env, result, "size", size) == nullptr ||
+      SetNamedNumber(env, result, "hugePageBytes", huge) == nullptr) {
+    return nullptr;
+  }
+  NAPI_CALL(env, napi_set_named_property(env, result, "objects", js_objects));
+  return result;
+}
+
+// The iTLB counters measure the thread which started them, which is the
+// thread running JavaScript (and the JIT-compiled code) in that environment.
+enum Counter {
+  counter_itlb_misses,
+  counter_instructions,
+  counter_count,
+};
+
+struct CounterSet {
+  int fds[counter_count] = {-1, -1};
+};
+
+int OpenCounter(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+void CloseCounters(CounterSet* counters) {
+  for (int& fd : counters->fds) {
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+}
+
+void DeleteCounters(napi_env env, void* data, void* hint) {
+  CounterSet* counters = static_cast<CounterSet*>(data);
+  CloseCounters(counters);
+  delete counters;
+}
+
+CounterSet* GetCounters(napi_env env) {
+  void* data = nullptr;
+  if (napi_get_instance_data(env, &data) != napi_ok || data == nullptr) {
+    CounterSet* counters = new CounterSet;
+    if (napi_set_instance_data(env, counters, DeleteCounters,
+                               nullptr) != napi_ok) {
+      delete counters;
+      return nullptr;
+    }
+    data = counters;
+  }
+  return static_cast<CounterSet*>(data);
+}
+
+// startITLBCounters(): undefined
+napi_value StartITLBCountersJS(napi_env env, napi_callback_info info) {
+  CounterSet* counters = GetCounters(env);
+  if (counters == nullptr) {
+    ThrowLastError(env);
+    return nullptr;
+  }
+  CloseCounters(counters);
+
+  counters->fds[counter_itlb_misses] =
+      OpenCounter(PERF_TYPE_HW_CACHE,
+                  PERF_COUNT_HW_CACHE_ITLB |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+  counters->fds[counter_instructions] =
+      OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+
+  for (int fd : counters->fds) {
+    if (fd < 0) {
+      int err = errno;
+      CloseCounters(counters);
+      ThrowErrno(env, "perf_event_open_failed", err);
+      return nullptr;
+    }
+  }
+  for (int fd : counters->fds) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  return nullptr;
+}
+
+// readITLBCounters(): { itlbMisses, instructions, mpki }
+// Counts are scaled when the kernel had to multiplex the counters.
+napi_value ReadITLBCountersJS(napi_env env, napi_callback_info info) {
+  CounterSet* counters = GetCounters(env);
+  if (counters == nullptr || counters->fds[0] < 0) {
+    napi_throw_error(env, "counters_not_started",
+                     "startITLBCounters() must be called first");
+    return nullptr;
+  }
+
+  double values[counter_count];
+  for (int idx = 0; idx < counter_count; idx++) {
+    uint64_t data[3];
+    if (read(counters->fds[idx], data, sizeof(data)) != sizeof(data)) {
+      ThrowErrno(env, "perf_event_read_failed", errno);
+      return nullptr;
+    }
+    values[idx] = (data[2] == 0) ? 0 :
+        static_cast<double>(data[0]) * data[1] / data[2];
+  }
+
+  napi_value result;
+  double instructions = values[counter_instructions];
+  double misses = values[counter_itlb_misses];
+  NAPI_CALL(env, napi_create_object(env, &result));
+  if (SetNamedNumber(env, result, "itlbMisses", misses) == nullptr ||
+      SetNamedNumber(env, result, "instructions", instructions) == nullptr ||
+      SetNamedNumber(env, result, "mpki",
+          (instructions == 0) ? 0 : 1000 * misses / instructions) == nullptr) {
+    return nullptr;
+  }
+  return result;
+}
+
+// stopITLBCounters(): undefined
+napi_value StopITLBCountersJS(napi_env env, napi_callback_info info) {
+  CounterSet* counters = GetCounters(env);
+  if (counters != nullptr) {
+    CloseCounters(counters);
+  }
+  return nullptr;
+}
+
+napi_value Init(napi_env env, napi_value exports) {
+  napi_property_descriptor properties[] = {
+    { "isLargePagesEnabled", nullptr, IsLargePagesEnabledJS,
+      nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+    { "mapNodeText", nullptr, MapNodeTextJS,
+      nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+    { "mapDSO", nullptr, MapDSOJS,
+      nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+    { "mapAdjacentDSOs", nullptr, MapAdjacentDSOsJS,
+      nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+    { "remapStats", nullptr, RemapStatsJS,
+      nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+    { "hugePageCoverage", nullptr, HugePageCoverageJS,
+      nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+    { "startITLBCounters", nullptr, StartITLBCountersJS,
+      nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+    { "readITLBCounters", nullptr, ReadITLBCountersJS,
+      nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+    { "stopITLBCounters", nullptr, StopITLBCountersJS,
+      nullptr, nullptr, nullptr, napi_enumerable, nullptr },
+  };
+
+  NAPI_CALL(env, napi_define_properties(env, exports,
+      sizeof(properties) / sizeof(properties[0]), properties));
+  return exports;
+}
+
+#undef NAPI_CALL
+
+}  // namespace
+}  // namespace largepage
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, largepage::Init)
@@ -0,0 +1,104 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <inttypes.h>
+#include "large_page.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+#define ADJACENT_LIBS 12
+
+#define DECLARE_ADJACENT_FN(id) extern "C" int adjacent_fn_##id(int x);
+DECLARE_ADJACENT_FN(1) DECLARE_ADJACENT_FN(2) DECLARE_ADJACENT_FN(3)
+DECLARE_ADJACENT_FN(4) DECLARE_ADJACENT_FN(5) DECLARE_ADJACENT_FN(6)
+DECLARE_ADJACENT_FN(7) DECLARE_ADJACENT_FN(8) DECLARE_ADJACENT_FN(9)
+DECLARE_ADJACENT_FN(10) DECLARE_ADJACENT_FN(11) DECLARE_ADJACENT_FN(12)
+
+typedef int (*AdjacentFn)(int);
+
+static AdjacentFn adjacent_fns[ADJACENT_LIBS] = {
+  adjacent_fn_1, adjacent_fn_2, adjacent_fn_3, adjacent_fn_4,
+  adjacent_fn_5, adjacent_fn_6, adjacent_fn_7, adjacent_fn_8,
+  adjacent_fn_9, adjacent_fn_10, adjacent_fn_11, adjacent_fn_12,
+};
+
+// A packed function no longer lies in a mapping of its object's file but in an
+// anonymous mapping, whose AnonHugePages field in the smaps file tells whether
+// it is backed by large pages.
+static bool IsOnLargePage(AdjacentFn fn) {
+  uintptr_t addr = reinterpret_cast<uintptr_t>(fn);
+  std::ifstream ifs("/proc/self/smaps");
+  std::string line;
+  bool in_mapping = false;
+
+  while (getline(ifs, line)) {
+    std::istringstream iss(line);
+    std::string first;
+    iss >> first;
+    if (first.empty()) {
+      continue;
+    }
+    if (*first.rbegin() != ':') {
+      uintptr_t start, end;
+      char dash;
+      std::string permission, offset, dev, inode, pathname;
+      std::istringstream header(first);
+      header >> std::hex >> start >> dash >> end;
+      iss >> permission >> offset >> dev >> inode >> pathname;
+      in_mapping = (addr >= start && addr < end && pathname.empty());
+    } else if (in_mapping && first == "AnonHugePages:") {
+      uint64_t kb = 0;
+      iss >> kb;
+      return kb > 0;
+    }
+  }
+  return false;
+}
+
+int main() {
+  largepage::MapStatus status;
+  bool is_enabled;
+
+  status = largepage::IsLargePagesEnabled(&is_enabled);
+  if (status != largepage::map_ok) {
+    cerr << "Failed to check enablement: "
+         << largepage::MapStatusStr(status) << endl;
+    return status;
+  }
+  if (!is_enabled) {
+    cerr << "Transparent Huge Pages are not enabled" << endl;
+    return -1;
+  }
+
+  // Each object's writable data lies next to its code, so the windows spanning
+  // them can only be packed with allow_writable. No other thread has been
+  // started yet, so no writes to that data can be lost.
+  cout << "Packing " << ADJACENT_LIBS << " adjacent objects ..." << endl;
+  status = largepage::MapAdjacentCodeToLargePages("libadjacent", true);
+  if (status != largepage::map_ok) {
+    cerr << "Failed to map: " << largepage::MapStatusStr(status) << endl;
+    return status;
+  }
+
+  int packed = 0;
+  for (int idx = 0; idx < ADJACENT_LIBS; idx++) {
+    if (adjacent_fns[idx](0) != idx + 1) {
+      cerr << "adjacent_fn_" << idx + 1 << " returned a wrong value" << endl;
+      return -1;
+    }
+    if (IsOnLargePage(adjacent_fns[idx])) {
+      packed++;
+    }
+  }
+  cout << packed << " of " << ADJACENT_LIBS
+       << " objects have their code on large pages" << endl;
+  if (packed == 0) {
+    cerr << "No object was packed" << endl;
+    return -1;
+  }
+  cout << "Success !" << endl;
+  return 0;
+}
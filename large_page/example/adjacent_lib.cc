@@ -0,0 +1,14 @@
+// A small shared object for adjacent_dsos_example. Its code is padded to about
+// 400KB, so that a few of these objects together span more than a 2MB page
+// while none of them can be mapped to large pages on its own. LIB_ID is set on
+// the command line to give each copy a distinct function.
+
+#define ADJACENT_FN_NAME(id) adjacent_fn_##id
+#define ADJACENT_FN(id) ADJACENT_FN_NAME(id)
+
+__asm__(".text\n"
+        ".skip 409600, 0xcc\n");
+
+extern "C" int ADJACENT_FN(LIB_ID)(int x) {
+  return x + LIB_ID;
+}
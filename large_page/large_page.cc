@@ -22,6 +22,8 @@
 
 #include "large_page.h"
 
+#include <dlfcn.h>
+#include <sys/auxv.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <climits>
@@ -30,6 +32,7 @@
 #include <fstream>
 #include <sstream>
 #include <regex>
+#include <vector>
 #include <inttypes.h>
 
 extern char __attribute__((weak))  __textsegment;
@@ -44,6 +47,7 @@ namespace largepage {
   using std::cerr;
   using std::regex;
   using std::smatch;
+  using std::vector;
 
 
 namespace {
@@ -70,10 +74,16 @@ constexpr uintptr_t LargePageAlignUp(uintptr_t addr) {
 MapStatus FindTextRegion(MemRange* region, const string& regexpr = "") {
   string exename;
   string map_line;
-  regex lib_regex(regexpr);
+  regex lib_regex;
   bool result;
   char selfexe[PATH_MAX] = {0};
 
+  try {
+    lib_regex.assign(regexpr);
+  } catch (const std::regex_error&) {
+    return map_invalid_regex;
+  }
+
   ifstream ifs("/proc/self/maps");
 
   if (!ifs) {
@@ -167,17 +177,21 @@ MapStatus IsTransparentHugePagesEnabled(bool* result) {
 // (__section__) to put it outside the ".text" section
 // (__aligned__) to align it at 2M boundary
 // (__noline__) to not inline this function
-// 2: This function should not call any function(s) that might be moved.
-// a. map a new area and copy the original code there
-// b. mmap using the start address with MAP_FIXED so we get exactly
-//    the same virtual address
-// c. madvise with MADV_HUGE_PAGE
-// d. If successful copy the code there and unmap the original region
+// 2: Other threads may be executing the code in the region while it is being
+//    moved, so the region must remain intact until it is replaced in one step.
+// a. map a new, 2M aligned area and madvise it with MADV_HUGE_PAGE
+// b. copy the original code there and make it executable. Holes, such as the
+//    inaccessible padding between the segments of adjacent objects, cannot be
+//    read and are left zero-filled in the new area instead.
+// c. mremap the new area over the original region. This replaces the original
+//    region atomically, at exactly the same virtual address, and keeps the
+//    large pages because both addresses are 2M aligned.
 MapStatus
 __attribute__((__section__(".lpstub")))
 __attribute__((__aligned__(hps)))
 __attribute__((__noinline__))
-MoveRegionToLargePages(const MemRange& r) {
+MoveRegionToLargePages(const MemRange& r, bool writable = false,
+                       const MemRange* holes = nullptr, size_t nholes = 0) {
   void* nmem = nullptr;
   void* tmem = nullptr;
   int ret = 0;
@@ -186,35 +200,31 @@ MoveRegionToLargePages(const MemRange& r) {
   size_t size = reinterpret_cast<size_t>(r.to) -
                 reinterpret_cast<size_t>(r.from);
 
-// Allocate temporary region preparing for copy
-  nmem = mmap(nullptr, size,
+// Reserve one large page more than needed so that a 2M aligned area of the
+// requested size is guaranteed to lie within the reservation, and release the
+// parts of the reservation below and above that area.
+  nmem = mmap(nullptr, size + hps,
               PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
   if (nmem == MAP_FAILED) {
     return map_see_errno;
   }
 
-  memcpy(nmem, r.from, size);
+  uintptr_t nmem_start = reinterpret_cast<uintptr_t>(nmem);
+  uintptr_t tmem_start = LargePageAlignUp(nmem_start);
+  uintptr_t tmem_end = tmem_start + size;
+  uintptr_t nmem_end = nmem_start + size + hps;
+  tmem = reinterpret_cast<void*>(tmem_start);
 
-// We already know the original page is r-xp
-// (PROT_READ, PROT_EXEC, MAP_PRIVATE)
-// We want PROT_WRITE because we are writing into it.
-// We want it at the fixed address and we use MAP_FIXED.
-#define CLEAN_EXIT_CHECK(oper)                          \
-  if (tmem == MAP_FAILED) {                             \
-    status = oper##_failed;                             \
-    ret = munmap(nmem, size);                           \
-    if (ret < 0) {                                      \
-      status = oper##_munmap_nmem_failed;               \
-    }                                                   \
-    return status;                                      \
+  if (tmem_start > nmem_start) {
+    ret = munmap(nmem, tmem_start - nmem_start);
+  }
+  if (ret == 0 && nmem_end > tmem_end) {
+    ret = munmap(reinterpret_cast<void*>(tmem_end), nmem_end - tmem_end);
+  }
+  if (ret < 0) {
+    munmap(nmem, size + hps);
+    return map_see_errno_munmap_nmem_failed;
   }
-
-  tmem = mmap(start, size,
-              PROT_READ | PROT_WRITE | PROT_EXEC,
-              MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1 , 0);
-CLEAN_EXIT_CHECK(map_see_errno_mmap_tmem);
-
-#undef CLEAN_EXIT_CHECK
 
 #define CLEAN_EXIT_CHECK(oper)                          \
   if (ret < 0) {                                        \
@@ -223,29 +233,36 @@ CLEAN_EXIT_CHECK(map_see_errno_mmap_tmem);
     if (ret < 0) {                                      \
       status = oper##_munmap_tmem_failed;               \
     }                                                   \
-    ret = munmap(nmem, size);                           \
-    if (ret < 0) {                                      \
-      status = (status == oper##_munmap_tmem_failed)    \
-        ? oper##_munmaps_failed                         \
-        : oper##_munmap_nmem_failed;                    \
-    }                                                   \
     return status;                                      \
   }
 
   ret = madvise(tmem, size, MADV_HUGEPAGE);
   CLEAN_EXIT_CHECK(map_see_errno_madvise_tmem);
 
-  memcpy(start, nmem, size);
-  ret = mprotect(start, size, PROT_READ | PROT_EXEC);
+  // The holes are sorted and lie within the region.
+  uintptr_t copied = reinterpret_cast<uintptr_t>(start);
+  for (size_t idx = 0; idx <= nholes; idx++) {
+    uintptr_t copy_end = (idx < nholes) ?
+        reinterpret_cast<uintptr_t>(holes[idx].from) :
+        reinterpret_cast<uintptr_t>(r.to);
+    memcpy(reinterpret_cast<char*>(tmem) +
+           (copied - reinterpret_cast<uintptr_t>(start)),
+           reinterpret_cast<void*>(copied), copy_end - copied);
+    if (idx < nholes) {
+      copied = reinterpret_cast<uintptr_t>(holes[idx].to);
+    }
+  }
+  ret = mprotect(tmem, size,
+                 PROT_READ | PROT_EXEC | (writable ? PROT_WRITE : 0));
   CLEAN_EXIT_CHECK(map_see_errno_mprotect);
 
-#undef CLEAN_EXIT_CHECK
-
-  // Release the old/temporary mapped region
-  ret = munmap(nmem, size);
-  if (ret < 0) {
-    status = map_see_errno_munmap_nmem_failed;
+  if (mremap(tmem, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, start) ==
+      MAP_FAILED) {
+    ret = -1;
   }
+  CLEAN_EXIT_CHECK(map_see_errno_mremap);
+
+#undef CLEAN_EXIT_CHECK
 
   return status;
 }
@@ -271,6 +288,121 @@ MapStatus CheckMemRange(const MemRange& r) {
   return map_ok;
 }
 
+struct Mapping {
+  uintptr_t start;
+  uintptr_t end;
+  string permission;
+  uint64_t inode;
+  string pathname;
+};
+
+// Read all the currently mapped memory regions, in ascending address order.
+MapStatus ReadMappings(vector<Mapping>* mappings) {
+  string map_line;
+  ifstream ifs("/proc/self/maps");
+
+  if (!ifs) {
+    return map_maps_open_failed;
+  }
+
+  while (getline(ifs, map_line)) {
+    Mapping m;
+    string dev;
+    char dash;
+    uint64_t offset;
+
+    istringstream iss(map_line);
+    iss >> std::hex >> m.start;
+    iss >> dash;
+    iss >> std::hex >> m.end;
+    iss >> m.permission;
+    iss >> offset;
+    iss >> dev;
+    iss >> std::dec >> m.inode;
+    if (iss.fail() || dash != '-' || m.permission.size() != 4) {
+      return map_malformed_maps_file;
+    }
+    iss >> m.pathname;
+
+    // Anonymous mappings directly following an object, such as its .bss, are
+    // attributed to that object.
+    if (m.pathname.empty() && !mappings->empty() &&
+        mappings->back().end == m.start) {
+      m.pathname = mappings->back().pathname;
+    }
+    mappings->push_back(m);
+  }
+  return map_ok;
+}
+
+// The mover is placed in the .lpstub section, on a 2MB page of its own.
+// Return that page, which must not be part of any region being moved. The rest
+// of the object containing the mover, usually the executable itself, may be
+// moved.
+MemRange MoverPage() {
+  uintptr_t mover = reinterpret_cast<uintptr_t>(MoveRegionToLargePages);
+  return MemRange(reinterpret_cast<void*>(LargePageAlignDown(mover)),
+                  reinterpret_cast<void*>(LargePageAlignDown(mover) + hps));
+}
+
+bool OverlapsMoverPage(uintptr_t from, uintptr_t to) {
+  MemRange page = MoverPage();
+  return from < reinterpret_cast<uintptr_t>(page.to) &&
+         to > reinterpret_cast<uintptr_t>(page.from);
+}
+
+// Collect the pathnames of the objects which contain the libc functions called
+// by the mover, i.e. libc itself, or the sanitizer runtime intercepting them.
+// A window containing any part of these objects cannot be moved, because their
+// code is unavailable while the window is being replaced. The functions are
+// looked up with RTLD_NEXT as well, because taking their address yields a PLT
+// entry, or a statically linked copy, in the object containing the mover, and
+// that object is not pinned as a whole. getauxval is not intercepted by the
+// sanitizers, so it locates libc even when the others resolve to interceptors.
+// Unless the caller is linked with BIND_NOW, the first call through each PLT
+// entry goes through the dynamic loader, so the loader (found via AT_BASE) is
+// pinned as well.
+vector<string> FindPinnedObjects(const vector<Mapping>& mappings) {
+  vector<string> pinned;
+  string mover_object;
+  uintptr_t mover = reinterpret_cast<uintptr_t>(MoveRegionToLargePages);
+  void* addresses[] = {
+    reinterpret_cast<void*>(&memcpy),
+    reinterpret_cast<void*>(&mmap),
+    reinterpret_cast<void*>(&madvise),
+    reinterpret_cast<void*>(&mprotect),
+    reinterpret_cast<void*>(&mremap),
+    reinterpret_cast<void*>(&munmap),
+    dlsym(RTLD_NEXT, "memcpy"),
+    dlsym(RTLD_NEXT, "mmap"),
+    dlsym(RTLD_NEXT, "madvise"),
+    dlsym(RTLD_NEXT, "mprotect"),
+    dlsym(RTLD_NEXT, "mremap"),
+    dlsym(RTLD_NEXT, "munmap"),
+    dlsym(RTLD_NEXT, "getauxval"),
+    reinterpret_cast<void*>(getauxval(AT_BASE)),
+  };
+
+  for (const Mapping& m : mappings) {
+    if (mover >= m.start && mover < m.end) {
+      mover_object = m.pathname;
+      break;
+    }
+  }
+
+  for (void* address : addresses) {
+    uintptr_t addr = reinterpret_cast<uintptr_t>(address);
+    for (const Mapping& m : mappings) {
+      if (addr >= m.start && addr < m.end && !m.pathname.empty() &&
+          m.pathname != mover_object) {
+        pinned.push_back(m.pathname);
+        break;
+      }
+    }
+  }
+  return pinned;
+}
+
 // Align the region to to be mapped to 2MB page boundaries and then move the
 // region to large pages.
 MapStatus AlignMoveRegionToLargePages(MemRange r) {
@@ -281,11 +413,176 @@ MapStatus AlignMoveRegionToLargePages(MemRange r) {
     return status;
   }
 
-  if (r.to <= (void*)MoveRegionToLargePages) {
-    return MoveRegionToLargePages(r);
+  // The region may lie on either side of the mover, which allows DSOs loaded
+  // above it to be remapped as well, but it must not touch the mover or the
+  // objects containing the functions it calls.
+  vector<Mapping> mappings;
+  status = ReadMappings(&mappings);
+  if (status != map_ok) {
+    return status;
+  }
+
+  uintptr_t from = reinterpret_cast<uintptr_t>(r.from);
+  uintptr_t to = reinterpret_cast<uintptr_t>(r.to);
+  if (OverlapsMoverPage(from, to)) {
+    return map_mover_overlaps;
+  }
+  vector<string> pinned = FindPinnedObjects(mappings);
+  for (const Mapping& m : mappings) {
+    if (m.end <= from || m.start >= to) {
+      continue;
+    }
+    for (const string& pathname : pinned) {
+      if (m.pathname == pathname) {
+        return map_mover_overlaps;
+      }
+    }
+  }
+
+  return MoveRegionToLargePages(r);
+}
+
+// A 2MB window can be packed into a single large page if all the mappings in
+// it are private mappings belonging to objects, at least one of which is
+// executable and, if a regex is given, belongs to a matching object. Writable
+// mappings are only allowed if requested. Special mappings such as [vdso] must
+// not be touched. Unmapped gaps, such as those left by the loader to align the
+// next object, are filled with zero pages.
+bool IsPackableWindow(const vector<Mapping>& mappings, uintptr_t window,
+                      const regex* lib_regex, bool allow_writable,
+                      const vector<string>& pinned) {
+  bool has_code = false;
+
+  for (const Mapping& m : mappings) {
+    if (m.end <= window) {
+      continue;
+    }
+    if (m.start >= window + hps) {
+      break;
+    }
+    if (m.pathname.empty() || m.pathname[0] == '[' ||
+        m.permission[3] != 'p' ||
+        (m.permission[1] == 'w' && !allow_writable) ||
+        (m.inode == 0 && m.permission[1] != 'w')) {
+      return false;
+    }
+    for (const string& pathname : pinned) {
+      if (m.pathname == pathname) {
+        return false;
+      }
+    }
+    if (m.permission[2] == 'x') {
+      if (lib_regex != nullptr && !regex_search(m.pathname, *lib_regex)) {
+        return false;
+      }
+      has_code = true;
+    }
+  }
+
+  return has_code;
+}
+
+// Collect the unmapped gaps and the inaccessible padding (---p) inside the
+// region, in ascending order. Neither can be read, and neither held anything
+// accessible, so the mover leaves them zero-filled instead of copying them.
+vector<MemRange> FindHoles(const vector<Mapping>& mappings, const MemRange& r) {
+  uintptr_t from = reinterpret_cast<uintptr_t>(r.from);
+  uintptr_t to = reinterpret_cast<uintptr_t>(r.to);
+  uintptr_t cursor = from;
+  vector<MemRange> holes;
+
+  for (const Mapping& m : mappings) {
+    if (m.end <= from || m.start >= to) {
+      continue;
+    }
+    uintptr_t start = (m.start < from) ? from : m.start;
+    uintptr_t end = (m.end > to) ? to : m.end;
+    if (start > cursor) {
+      holes.push_back(MemRange(reinterpret_cast<void*>(cursor),
+                               reinterpret_cast<void*>(start)));
+    }
+    if (m.permission[0] == '-') {
+      holes.push_back(MemRange(reinterpret_cast<void*>(start),
+                               reinterpret_cast<void*>(end)));
+    }
+    cursor = end;
+  }
+  if (cursor < to) {
+    holes.push_back(MemRange(reinterpret_cast<void*>(cursor),
+                             reinterpret_cast<void*>(to)));
+  }
+  return holes;
+}
+
+// Whether any of the mappings inside the region is writable, in which case the
+// region has to stay writable after it has been moved.
+bool IsWritableRegion(const vector<Mapping>& mappings, const MemRange& r) {
+  uintptr_t from = reinterpret_cast<uintptr_t>(r.from);
+  uintptr_t to = reinterpret_cast<uintptr_t>(r.to);
+
+  for (const Mapping& m : mappings) {
+    if (m.end > from && m.start < to && m.permission[1] == 'w') {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Find the 2MB windows which span the mappings of one or more adjacent
+// objects, and move each run of consecutive windows to large pages.
+MapStatus PackAdjacentRegionsToLargePages(const regex* lib_regex,
+                                          bool allow_writable) {
+  vector<Mapping> mappings;
+  MapStatus status = ReadMappings(&mappings);
+  if (status != map_ok) {
+    return status;
+  }
+
+  vector<string> pinned = FindPinnedObjects(mappings);
+  vector<MemRange> runs;
+  uintptr_t next_window = 0;
+
+  for (const Mapping& m : mappings) {
+    if (m.permission[2] != 'x') {
+      continue;
+    }
+    uintptr_t window = LargePageAlignDown(m.start);
+    if (window < next_window) {
+      window = next_window;
+    }
+    for (; window < m.end; window += hps) {
+      if (OverlapsMoverPage(window, window + hps) ||
+          !IsPackableWindow(mappings, window, lib_regex, allow_writable,
+                            pinned)) {
+        continue;
+      }
+      if (!runs.empty() &&
+          reinterpret_cast<uintptr_t>(runs.back().to) == window) {
+        runs.back().to = reinterpret_cast<void*>(window + hps);
+      } else {
+        runs.push_back(MemRange(reinterpret_cast<void*>(window),
+                                reinterpret_cast<void*>(window + hps)));
+      }
+    }
+    next_window = window;
+  }
+
+  if (runs.empty()) {
+    return map_region_not_found;
   }
 
-  return map_mover_overlaps;
+  // A failed move leaves its run untouched, but the runs before it have
+  // already been moved, which the caller is told about.
+  for (size_t idx = 0; idx < runs.size(); idx++) {
+    const MemRange& r = runs[idx];
+    vector<MemRange> holes = FindHoles(mappings, r);
+    status = MoveRegionToLargePages(r, IsWritableRegion(mappings, r),
+                                    holes.data(), holes.size());
+    if (status != map_ok) {
+      return (idx == 0) ? status : map_see_errno_partially_moved;
+    }
+  }
+  return map_ok;
 }
 
 }  // namespace
@@ -321,6 +618,49 @@ MapStatus MapStaticCodeToLargePages(void* from, void* to) {
   return AlignMoveRegionToLargePages(MemRange(from, to));
 }
 
+// Map the code of small objects that lie next to each other to 2MB pages.
+// Objects whose text is smaller than 2MB can never be mapped by the functions
+// above, but a 2MB window spanning several adjacent objects can:
+// 1. Find the 2MB-aligned windows that contain code, and whose mappings are
+//    all private, non-writable mappings of objects. If regexpr is not empty,
+//    all the executable mappings in the window must belong to objects matching
+//    it. Windows touching the mover's page or the objects containing the libc
+//    functions it calls are skipped.
+// 2. Move each run of adjacent windows to large pages as described above.
+//    Unmapped gaps and inaccessible padding in a run are not copied.
+//
+// A 2MB page has a single set of permissions, so the whole window ends up
+// PROT_READ | PROT_EXEC. Read-only data of the objects in the window therefore
+// becomes executable, and unmapped gaps and inaccessible padding between their
+// segments become readable and are filled with zeroes.
+//
+// If moving a run fails, that run is left untouched. The runs moved before it
+// stay moved, and map_see_errno_partially_moved is returned.
+//
+// Small objects are usually followed by their writable data, so most windows
+// also contain writable mappings. These windows are only moved if
+// allow_writable is set. A run containing a writable mapping ends up
+// PROT_READ | PROT_WRITE | PROT_EXEC as a whole, including the code and the
+// RELRO data of every object in it, so RELRO and W^X no longer protect those
+// objects (see README.md). Restoring the permissions of the individual
+// mappings with mprotect() would split the large page again. Writes made by
+// other threads to such a run while it is being moved are lost, so this must
+// be done before any other threads are started.
+MapStatus MapAdjacentCodeToLargePages(const std::string& regexpr,
+                                      bool allow_writable) {
+  if (regexpr.size() == 0) {
+    return PackAdjacentRegionsToLargePages(nullptr, allow_writable);
+  }
+
+  regex lib_regex;
+  try {
+    lib_regex.assign(regexpr);
+  } catch (const std::regex_error&) {
+    return map_invalid_regex;
+  }
+  return PackAdjacentRegionsToLargePages(&lib_regex, allow_writable);
+}
+
 MapStatus IsLargePagesEnabled(bool* result) {
   return IsTransparentHugePagesEnabled(result);
 }
@@ -344,7 +684,7 @@ const string& MapStatusStr(MapStatus status, bool fulltext) {
     "map_maps_open_failed",
       "failed to open maps file",
     "map_mover_overlaps",
-      "the remapping function is part of the region",
+      "the remapping function or a function it calls is part of the region",
     "map_null_regex",
       "regex was NULL",
     "map_region_not_found",
@@ -373,8 +713,14 @@ const string& MapStatusStr(MapStatus status, bool fulltext) {
       "mprotect and unmappings failed",
     "map_see_errno_mprotect_munmap_tmem_failed",
       "mprotect and unmapping of destination failed",
+    "map_see_errno_mremap_failed",
+      "moving the destination over the region failed",
+    "map_see_errno_mremap_munmap_tmem_failed",
+      "moving the destination over the region and its unmapping failed",
     "map_see_errno_munmap_nmem_failed",
       "unmapping of temporary failed",
+    "map_see_errno_partially_moved",
+      "moving a region failed after preceding regions had been moved",
     "map_unsupported_platform",
       "mapping to large pages is not supported on this platform",
   };
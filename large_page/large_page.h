@@ -52,12 +52,17 @@ namespace largepage {
         map_see_errno_mprotect_munmap_nmem_failed,
         map_see_errno_mprotect_munmaps_failed,
         map_see_errno_mprotect_munmap_tmem_failed,
+        map_see_errno_mremap_failed,
+        map_see_errno_mremap_munmap_tmem_failed,
         map_see_errno_munmap_nmem_failed,
+        map_see_errno_partially_moved,
         map_unsupported_platform,
     };
 
     MapStatus MapStaticCodeToLargePages(const std::string& regexpr = "");
     MapStatus MapStaticCodeToLargePages(void* from, void* to);
+    MapStatus MapAdjacentCodeToLargePages(const std::string& regexpr = "",
+                                          bool allow_writable = false);
     MapStatus IsLargePagesEnabled(bool* result);
     const string& MapStatusStr(MapStatus status, bool fulltext = true);
 };  // namespace largepage
@@ -0,0 +1,484 @@
+#!/bin/bash
+
+# Copyright (C) 2018 Intel Corporation
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files
+# (the "Software"), to deal in the Software without restriction,
+# including without limitation the rights to use, copy, modify, merge,
+# publish, distribute, sublicense, and/or sell copies of the Software,
+# and to permit persons to whom the Software is furnished to do so,
+# subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included
+# in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES
+# OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+# ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE
+# OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# SPDX-License-Identifier: MIT
+
+# Attribute DSB misses and MITE uop delivery to functions and to the 32 byte
+# code windows inside them, and recommend per-function alignment. Where
+# metric_dsb_cache reports whole-process ratios, this script samples the same
+# front end events with "perf record" so that the hot spots can be located.
+
+SCRIPTS_DIR=`dirname $0`
+source ${SCRIPTS_DIR}/utils.sh
+
+process_id=$$
+
+default_collect_time=10
+default_sample_period=20003
+default_top_functions=20
+default_window_size=32
+
+# Sampled events. frontend_retired.dsb_miss is a precise event and therefore
+# attributes the miss to the instruction which was fetched from the legacy
+# decode pipeline (MITE) rather than to a skid location.
+dsb_miss_pmu="frontend_retired.dsb_miss"
+mite_uops_pmu="idq.mite_uops"
+
+# Counted (not sampled) events used to size the predicted benefit. Like the
+# samples, they are restricted to user space. Every DSB miss switches the front
+# end to MITE, so frontend_retired.dsb_miss also counts the switches.
+stat_pmu_array=(idq.dsb_uops idq.mite_uops dsb2mite_switches.penalty_cycles ${dsb_miss_pmu} cycles)
+
+#####################################################################
+# No change require below this line
+#####################################################################
+collect_time=$default_collect_time
+sample_period=$default_sample_period
+top_functions=$default_top_functions
+window_size=$default_window_size
+output_dir="."
+
+app_process_id=""
+command_name=""
+verbose_mode=0
+
+PERF_RECORD_FILE="/tmp/dsb_align_${process_id}_perf.data"
+PERF_STAT_FILE="/tmp/dsb_align_${process_id}_perf_stat.txt"
+PERF_SCRIPT_FILE="/tmp/dsb_align_${process_id}_perf_script.txt"
+PROFILE_FILE="/tmp/dsb_align_${process_id}_profile.txt"
+
+function usage() {
+  local pname=`basename $0`
+  echo "Usage:"
+  echo "$pname [-p pid | -e \"application <args,...>\"] [-t time] [-n count] [-c period] [-w bytes] [-o dir] [-v] [-h]"
+  echo
+  echo "  -p pid : application process id to profile"
+  echo "  -e : Specify application to run with arguments."
+  echo "  -t time : time in seconds when profiling a pid. Default ${default_collect_time}s"
+  echo "  -n count : number of functions to recommend. Default ${default_top_functions}"
+  echo "  -c period : sample period for the sampled events. Default ${default_sample_period}"
+  echo "  -w bytes : DSB window size in bytes. Default ${default_window_size}"
+  echo "  -o dir : directory in which to write the recommendations. Default ."
+  echo "  -v : Verbose mode"
+  echo "  -h : Help message"
+  echo
+  echo "  Examples:"
+  echo "  1) Profile a running process for 30 seconds:"
+  echo "    $ $pname -p 2345 -t 30"
+  echo
+  echo "  2) Profile an application and write the recommendations to /tmp/dsb:"
+  echo "    $ $pname -e \"node index.js\" -o /tmp/dsb"
+  exit
+}
+
+if [ $# -eq 0 ]; then
+    usage
+fi
+
+while [ "$1" != "" ]; do
+  case $1 in
+    -p) shift
+      app_process_id=$1
+      ;;
+    -e) shift
+      command_name=$1
+      ;;
+    -t) shift
+      collect_time=$1
+      ;;
+    -n) shift
+      top_functions=$1
+      ;;
+    -c) shift
+      sample_period=$1
+      ;;
+    -w) shift
+      window_size=$1
+      ;;
+    -o) shift
+      output_dir=$1
+      ;;
+    -v) verbose_mode=1
+      ;;
+    *) usage
+      exit 1
+  esac
+  shift
+done
+
+if [ "x${command_name}" == "x" -a "x${app_process_id}" == "x" ]; then
+  echo "ERROR: Please specify the application process id or the application to run. Exiting."
+  exit
+fi
+
+if [ "x${command_name}" != "x" -a "x${app_process_id}" != "x" ]; then
+  echo "ERROR: -p and -e are mutually exclusive. Exiting."
+  exit
+fi
+
+mkdir -p ${output_dir}
+if [ $? != 0 ]; then
+  echo "ERROR: Unable to create ${output_dir}. Exiting."
+  exit
+fi
+
+function join_pmus() {
+  local local_pmus
+  for item in $*
+  do
+    if [ "x${local_pmus}" == "x" ]; then
+      local_pmus="$item"
+    else
+      local_pmus="$local_pmus,$item"
+    fi
+  done
+  echo $local_pmus
+}
+
+# Run perf once to count and once to sample. The counters are only used to
+# scale the prediction, so they do not need to be collected at the same time as
+# the samples.
+function collect_perf_data() {
+  local stat_pmus=`join_pmus ${stat_pmu_array[*]/%/:u}`
+  # Only user space is sampled. Kernel code is not built with the recommended
+  # flags, so ranking it would only crowd out the application's functions.
+  local record_pmus="${dsb_miss_pmu}:upp,${mite_uops_pmu}:u"
+  local target
+
+  if [ "x${app_process_id}" != "x" ]; then
+    target="-p ${app_process_id} sleep ${collect_time}"
+  else
+    target="${command_name}"
+  fi
+
+  echo "--------------------------------------------------"
+  echo "perf stat -e ${stat_pmus} ${target}"
+  echo "--------------------------------------------------"
+  perf stat -o ${PERF_STAT_FILE} -e ${stat_pmus} ${target}
+  if [ $? != 0 ]; then
+    echo "Perf stat failed. Exiting"
+    exit
+  fi
+
+  echo "--------------------------------------------------"
+  echo "perf record -c ${sample_period} -e ${record_pmus} ${target}"
+  echo "--------------------------------------------------"
+  perf record -o ${PERF_RECORD_FILE} -c ${sample_period} -e ${record_pmus} ${target}
+  if [ $? != 0 ]; then
+    echo "Perf record failed. Exiting"
+    exit
+  fi
+
+  # Symbol names are kept mangled, because they are used to build the input
+  # section names (.text.<symbol>) in the recommended linker script.
+  perf script -i ${PERF_RECORD_FILE} --no-demangle \
+    -F event,period,ip,sym,symoff,dso > ${PERF_SCRIPT_FILE}
+  if [ $? != 0 ]; then
+    echo "Perf script failed. Exiting"
+    exit
+  fi
+}
+
+# Aggregate the samples per function. Each output line has the form
+#   <dsb_misses> <mite_uops> <hot_window_offset> <hot_window_share%> <dso> <symbol>
+# sorted by descending DSB misses. The hot window is the DSB window touched by
+# the function that accumulated the most DSB misses. DSB windows are aligned in
+# the address space rather than relative to the function, so they are computed
+# from the sampled ip. The offset of the hot window is relative to the function
+# entry and is negative if the function does not start on a window boundary. A
+# hot window that does not contain the function entry is usually a loop header.
+function build_profile() {
+  awk -v dsb_pmu="${dsb_miss_pmu}" -v mite_pmu="${mite_uops_pmu}" \
+      -v window="${window_size}" '
+    function hex2dec(h,    i, c, v) {
+      v = 0
+      sub(/^0x/, "", h)
+      h = tolower(h)
+      for (i = 1; i <= length(h); i++) {
+        c = index("0123456789abcdef", substr(h, i, 1))
+        if (c == 0) break
+        v = v * 16 + c - 1
+      }
+      return v
+    }
+    # Each line has the form "<period> <event>: <ip> <symbol>+0x<offset> (<dso>)".
+    # perf prints the period before the event, and the event name carries its
+    # modifiers, so the event is found as the field ending in ":".
+    NF >= 5 {
+      ev = 0
+      for (i = 2; i < NF; i++) {
+        if ($i ~ /:$/) {
+          ev = i
+          break
+        }
+      }
+      if (ev == 0) next
+      event = $ev
+      dso = $NF
+      gsub(/[()]/, "", dso)
+      # Skip special objects such as [vdso], which cannot be relinked.
+      if (dso ~ /^\[/) next
+      symoff = $(NF - 1)
+      if (symoff ~ /^\[unknown\]/) next
+      plus = match(symoff, /\+0x[0-9a-fA-F]+$/)
+      if (plus == 0) next
+      sym = substr(symoff, 1, plus - 1)
+      off = hex2dec(substr(symoff, plus + 1))
+      ip = hex2dec($(ev + 1))
+      key = dso " " sym
+      period = $(ev - 1) + 0
+      if (index(event, dsb_pmu) == 1) {
+        dsb[key] += period
+        w = int(ip / window) * window
+        # Addresses exceed the integer range of some awks, which would then
+        # format the subscript with CONVFMT and merge neighbouring windows.
+        wkey = key SUBSEP sprintf("%.0f", w)
+        win[wkey] += period
+        if (win[wkey] > best[key]) {
+          best[key] = win[wkey]
+          bestoff[key] = w - (ip - off)
+        }
+      } else if (index(event, mite_pmu) == 1) {
+        mite[key] += period
+        if (!(key in dsb)) dsb[key] = 0
+      }
+    }
+    END {
+      for (key in dsb) {
+        if (dsb[key] == 0) continue
+        printf "%d %d %d %.1f %s\n", dsb[key], mite[key] + 0, bestoff[key],
+               100 * best[key] / dsb[key], key
+      }
+    }' ${PERF_SCRIPT_FILE} | sort -k1,1nr > ${PROFILE_FILE}
+}
+
+# Map a function to the translation unit that defines it. This requires the
+# object to carry debug information; "unknown" is reported otherwise.
+function source_file_of() {
+  local dso="$1"
+  local sym="$2"
+  local addr=`nm "$dso" 2>/dev/null | awk -v s="$sym" '$3 == s {print $1; exit}'`
+  if [ "x${addr}" == "x" ]; then
+    addr=`nm -D "$dso" 2>/dev/null | awk -v s="$sym" '$3 == s {print $1; exit}'`
+  fi
+  if [ "x${addr}" == "x" ]; then
+    echo "unknown"
+    return
+  fi
+  local file=`addr2line -e "$dso" 0x${addr} 2>/dev/null | cut -d':' -f1`
+  if [ "x${file}" == "x" -o "${file}" == "??" ]; then
+    echo "unknown"
+  else
+    echo "$file"
+  fi
+}
+
+# Write, per object, a linker script which groups the hot functions together at
+# the start of .text and places each of them relative to a DSB window boundary
+# so that its hot window starts on one, a symbol ordering file for linkers
+# supporting --symbol-ordering-file, and a list of per translation unit
+# -falign-* overrides. The linker script replaces ld.implicit.script, so the
+# hot functions follow __textsegment and are part of the region mapped to large
+# pages.
+function write_recommendations() {
+  local tu_flags_file="${output_dir}/dsb_tu_flags.txt"
+  local report_file="${output_dir}/dsb_report.txt"
+  local rank=0
+  local dsos=()
+
+  : > ${tu_flags_file}
+  : > ${report_file}
+
+  printf "%-4s %8s %8s %8s %8s %6s %-32s %s\n" "rank" "dsb%" "mite%" \
+    "window" "window%" "pad" "object" "function" >> ${report_file}
+
+  local total_dsb=`awk '{s += $1} END {print s + 0}' ${PROFILE_FILE}`
+  local total_mite=`awk '{s += $2} END {print s + 0}' ${PROFILE_FILE}`
+  if [ "${total_dsb}" == "0" ]; then
+    echo "ERROR: No ${dsb_miss_pmu} samples were attributed to a function."
+    exit
+  fi
+
+  while read dsb mite hot_off hot_share dso sym
+  do
+    rank=`expr $rank + 1`
+    [ $rank -gt $top_functions ] && break
+
+    local dsb_pct=`echo "scale=2;100*${dsb}/${total_dsb}" | bc -l`
+    local mite_pct=0
+    if [ "${total_mite}" != "0" ]; then
+      mite_pct=`echo "scale=2;100*${mite}/${total_mite}" | bc -l`
+    fi
+    # The function entry currently lies phase bytes into its window. If the hot
+    # window contains the entry, the entry is aligned to a window boundary.
+    # Otherwise the hot window lies in the body, usually at a loop header, and
+    # the function is placed pad bytes after a window boundary so that the hot
+    # window stays on one. Compiling with -falign-loops moves the loop header
+    # onto a boundary instead, which overrides the padding.
+    local phase=$(( ((-hot_off % window_size) + window_size) % window_size ))
+    local pad=0
+    local flags="-falign-functions=${window_size}"
+    if [ ${hot_off} -gt 0 ]; then
+      pad=${phase}
+      flags="-falign-loops=${window_size} -falign-jumps=${window_size}"
+    fi
+
+    printf "%-4s %8s %8s %+8d %8s %6s %-32s %s\n" "$rank" "$dsb_pct" \
+      "$mite_pct" "$hot_off" "$hot_share" "$pad" "`basename $dso`" "$sym" \
+      >> ${report_file}
+
+    local base=`basename $dso`
+    local ld_file="${output_dir}/dsb_${base}.ld"
+    local order_file="${output_dir}/dsb_${base}.order"
+    if [ ! -f "${ld_file}.body" ]; then
+      dsos[${#dsos[@]}]="$dso"
+      : > "${ld_file}.body"
+      : > "${order_file}"
+    fi
+    echo "      . = ALIGN(${window_size});" >> "${ld_file}.body"
+    if [ ${pad} -gt 0 ]; then
+      echo "      . += ${pad};" >> "${ld_file}.body"
+    fi
+    echo "      *(.text.${sym} .text.hot.${sym})" >> "${ld_file}.body"
+    echo "${sym}" >> "${order_file}"
+
+    echo "`source_file_of $dso $sym` ${flags}" >> ${tu_flags_file}
+  done < ${PROFILE_FILE}
+
+  # Merge the flags of translation units with several hot functions.
+  sort -u ${tu_flags_file} | awk '
+    { for (i = 2; i <= NF; i++) {
+        if (!(($1, $i) in seen)) { seen[$1, $i] = 1; flags[$1] = flags[$1] " " $i }
+      } }
+    END { for (tu in flags) print tu flags[tu] }' | sort > ${tu_flags_file}.tmp
+  mv ${tu_flags_file}.tmp ${tu_flags_file}
+
+  for dso in "${dsos[@]}"
+  do
+    local base=`basename $dso`
+    local ld_file="${output_dir}/dsb_${base}.ld"
+    {
+      echo "  SECTIONS {"
+      echo "    .text ALIGN(0x200000): {"
+      echo "      __textsegment = .;"
+      cat "${ld_file}.body"
+      echo "      *(.text .text.*)"
+      echo "    }"
+      echo "  }"
+      echo "  INSERT AFTER .init;"
+      echo
+      echo "  SECTIONS {"
+      echo "    .lpstub ALIGN(0x200000): {"
+      echo "       *(.lpstub)"
+      echo "    }"
+      echo "  }"
+      echo "  INSERT AFTER .text;"
+    } > ${ld_file}
+    rm -f "${ld_file}.body"
+  done
+}
+
+# The prediction assumes that DSB-to-MITE switches and their penalty cycles are
+# distributed like the sampled DSB misses. Alignment only helps with the misses
+# in windows that the recommendations move, so the recoverable misses of each
+# recommended function are those of its hot window, provided that the window is
+# moved: the entry of a function whose hot window contains it is aligned, which
+# moves the window unless the entry already is on a window boundary, and the
+# loop headers of a function whose hot window lies in its body are aligned by
+# -falign-loops. Misses elsewhere in the function are not counted as
+# recoverable, nor are those caused by DSB capacity rather than alignment.
+function predict_switch_reduction() {
+  local a=`return_pmu_value "dsb2mite_switches.penalty_cycles" $PERF_STAT_FILE`
+  local b=`return_pmu_value "cycles" $PERF_STAT_FILE`
+  local s=`return_pmu_value "${dsb_miss_pmu}" $PERF_STAT_FILE`
+  local total_dsb=`awk '{s += $1} END {print s + 0}' ${PROFILE_FILE}`
+  local recoverable_dsb=`head -n ${top_functions} ${PROFILE_FILE} | \
+    awk -v window=${window_size} '
+      { phase = ((-$3 % window) + window) % window
+        if ($3 > 0 || phase != 0) s += $1 * $4 / 100 }
+      END { printf "%.0f\n", s }'`
+
+  echo
+  echo "================================================="
+  echo "Predicted DSB switch reduction"
+  echo "--------------------------------------------------"
+  echo "FORMULA: switches saved = (r/d)*s"
+  echo "         penalty cycles saved = (r/d)*a"
+  echo "         where, a=dsb2mite_switches.penalty_cycles"
+  echo "                b=cycles"
+  echo "                s=${dsb_miss_pmu} (DSB-to-MITE switches)"
+  echo "                r=sampled ${dsb_miss_pmu} in the hot windows moved"
+  echo "                  in the top ${top_functions} functions"
+  echo "                d=sampled ${dsb_miss_pmu} in all functions"
+  echo "================================================="
+
+  if [ $a == -1 -o $b == -1 -o $s == -1 ]; then
+    echo "ERROR: Prediction can't be derived. Missing pmus"
+    return
+  fi
+
+  local share=`echo "scale=$bc_scale;${recoverable_dsb}/${total_dsb}" | bc -l`
+  local switches_saved=`echo "scale=0;${share}*${s}/1" | bc -l`
+  local saved=`echo "scale=0;${share}*${a}/1" | bc -l`
+  local before=`echo "scale=$bc_scale;100*(${a}/${b})" | bc -l`
+  local after=`echo "scale=$bc_scale;100*((${a}-${saved})/${b})" | bc -l`
+  echo "recoverable_dsb_miss%=`echo "scale=2;100*${share}/1" | bc -l`"
+  echo "dsb2mite_switches_saved=${switches_saved}"
+  echo "dsb2mite_switches.penalty_cycles_saved=${saved}"
+  echo "metric_ifu_switch_penalty%=${before}"
+  echo "metric_ifu_switch_penalty_predicted%=${after}"
+  echo
+}
+
+function cleanup() {
+  if [ $verbose_mode -eq 0 ]; then
+    rm -f ${PERF_RECORD_FILE} ${PERF_STAT_FILE} ${PERF_SCRIPT_FILE} ${PROFILE_FILE}
+  else
+    echo "Intermediate files:"
+    echo "  ${PERF_RECORD_FILE}"
+    echo "  ${PERF_STAT_FILE}"
+    echo "  ${PERF_SCRIPT_FILE}"
+    echo "  ${PROFILE_FILE}"
+  fi
+}
+
+collect_perf_data
+build_profile
+write_recommendations
+
+echo
+echo "================================================="
+echo "Functions ranked by ${dsb_miss_pmu}"
+echo "--------------------------------------------------"
+cat ${output_dir}/dsb_report.txt
+echo
+echo "Per translation unit flags: ${output_dir}/dsb_tu_flags.txt"
+echo "Linker scripts replacing ld.implicit.script (require -ffunction-sections):"
+ls ${output_dir}/dsb_*.ld | sed 's/^/  /'
+echo "Symbol ordering files (lld --symbol-ordering-file):"
+ls ${output_dir}/dsb_*.order | sed 's/^/  /'
+
+predict_switch_reduction
+cleanup
+
+exit